@@ -0,0 +1,867 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sysinfo.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "pzip_internal.h"
+
+/*
+ Microbenchmarks and differential checks for the hot loops of the tools:
+ compress_segment (pzip.c), zip (my-zip.c), unzip (my-unzip.c) and search_word (my-grep.c).
+
+ The tools are included as they are so the exact same kernels are measured; their
+ main and open_file functions are renamed to avoid clashes.
+
+ The checks also run the my-pzip binary, so build it first.
+
+ Build: gcc -O2 -o my-bench my-bench.c pzip.c -pthread
+ Usage: ./my-bench [-c] [-s size] [-r repeats] [-p my-pzip]
+        -c  run only the differential checks, exit status 1 on a mismatch
+        -p  path of the my-pzip binary, ./my-pzip by default
+ */
+
+#define main zip_main
+#define open_file zip_open_file
+#include "my-zip.c"
+#undef open_file
+#undef main
+
+#define main unzip_main
+#define open_file unzip_open_file
+#include "my-unzip.c"
+#undef open_file
+#undef main
+
+#define main grep_main
+#define open_file grep_open_file
+#include "my-grep.c"
+#undef open_file
+#undef main
+
+#define DEFAULT_SIZE (4 * 1024 * 1024)
+#define DEFAULT_REPEATS 5
+
+/* Input of one benchmark or check */
+typedef struct {
+    char* data;
+    size_t size;
+    char label[64];
+} input_t;
+
+/* Best time of the repeats of one kernel */
+typedef struct {
+    uint64_t ns;
+    uint64_t cycles;
+} timing_t;
+
+/* Deterministic xorshift generator, so every run measures the same inputs */
+static uint64_t rng_state = 88172645463325252ULL;
+
+uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Time stamp counter where available, 0 otherwise (cycles/byte is then reported as n/a) */
+uint64_t now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void* checked_malloc(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        perror("my-bench: malloc failed");
+        exit(1);
+    }
+    return p;
+}
+
+/* Characters used by fill_runs */
+typedef struct {
+    const char* chars;
+    int len;            // Number of chars (chars may contain '\0')
+    const char* name;
+} alphabet_t;
+
+static const alphabet_t LETTERS = {"abcdefghijklmnopqrstuvwxyz", 26, "a-z"};
+
+/* Fills data with runs of characters from alphabet whose lengths are uniform in
+   [1, 2 * mean_run - 1]. Consecutive runs always use different characters so the
+   run count is exact. */
+void fill_runs(char* data, size_t size, size_t mean_run, const alphabet_t* alphabet) {
+    size_t i = 0;
+    int prev = -1;
+    while (i < size) {
+        size_t run = 1 + next_random() % (2 * mean_run - 1);
+        int k;
+        do {
+            k = next_random() % alphabet->len;
+        } while (k == prev && alphabet->len > 1);
+        char c = alphabet->chars[k];
+        for (; run > 0 && i < size; run--)
+            data[i++] = c;
+        prev = k;
+    }
+}
+
+/* Fills data with lines of line_len random letters (newline included). percent of the
+   lines contain word at a random position. */
+void fill_lines(char* data, size_t size, size_t line_len, const char* word, int percent) {
+    size_t word_len = strlen(word);
+    size_t i = 0;
+    while (i < size) {
+        size_t len = line_len;
+        if (len > size - i)
+            len = size - i;
+        for (size_t j = 0; j + 1 < len; j++)
+            data[i + j] = 'a' + next_random() % 26;
+        if (len > word_len + 1 && (int) (next_random() % 100) < percent)
+            memcpy(data + i + next_random() % (len - word_len), word, word_len);
+        data[i + len - 1] = '\n';
+        i += len;
+    }
+}
+
+/* Writes data to a new temporary file and returns its name (caller unlinks and frees) */
+char* write_temp_file(const char* data, size_t size) {
+    char* name = strdup("/tmp/my-bench-XXXXXX");
+    int fd = name ? mkstemp(name) : -1;
+    if (fd < 0) {
+        perror("my-bench: cannot create temporary file");
+        exit(1);
+    }
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, data + written, size - written);
+        if (n <= 0) {
+            perror("my-bench: cannot write temporary file");
+            exit(1);
+        }
+        written += n;
+    }
+    close(fd);
+    return name;
+}
+
+/* unzip and search_word print to stdout, these route stdout to a file while they run */
+int redirect_stdout(const char* path) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (saved < 0 || fd < 0) {
+        perror("my-bench: cannot redirect stdout");
+        exit(1);
+    }
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    return saved;
+}
+
+void restore_stdout(int saved) {
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+/* Reads a whole file into memory */
+char* read_file(const char* path, size_t* size) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        perror("my-bench: cannot read file");
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    rewind(fp);
+    char* data = checked_malloc(*size);
+    if (fread(data, 1, *size, fp) != *size) {
+        perror("my-bench: cannot read file");
+        exit(1);
+    }
+    fclose(fp);
+    return data;
+}
+
+/* Writes (or appends) data to path */
+void write_file(const char* path, const char* data, size_t size, bool append) {
+    FILE* fp = fopen(path, append ? "ab" : "wb");
+    if (!fp || fwrite(data, 1, size, fp) != size || fclose(fp) != 0) {
+        perror("my-bench: cannot write file");
+        exit(1);
+    }
+}
+
+/* my-zip output of data, in memory */
+char* zip_to_memory(const char* data, size_t size, size_t* out_len) {
+    char* out = NULL;
+    FILE* src = fmemopen((void*) data, size, "r");
+    FILE* dest = open_memstream(&out, out_len);
+    if (!src || !dest) {
+        perror("my-bench: cannot open memory stream");
+        exit(1);
+    }
+    zip(src, dest);
+    fclose(src);
+    fclose(dest);
+    return out;
+}
+
+/*
+ Benchmarks
+ */
+
+void report(const char* kernel, const char* label, size_t bytes, timing_t t) {
+    double ns_per_byte = bytes ? (double) t.ns / bytes : 0;
+    if (t.cycles) {
+        printf("%-18s %-22s %10zu %10.3f %12.3f\n", kernel, label, bytes,
+               ns_per_byte, (double) t.cycles / bytes);
+    } else {
+        printf("%-18s %-22s %10zu %10.3f %12s\n", kernel, label, bytes, ns_per_byte, "n/a");
+    }
+}
+
+void keep_best(timing_t* best, uint64_t ns, uint64_t cycles) {
+    if (best->ns == 0 || ns < best->ns) {
+        best->ns = ns;
+        best->cycles = cycles;
+    }
+}
+
+void bench_compress_segment(const input_t* in, int repeats) {
+    thread_arg_t targ = {0};
+    targ.data = in->data;
+    targ.start = 0;
+    targ.end = in->size;
+    timing_t best = {0};
+    /* First call sizes the run arrays, so the repeats measure only the loop */
+    compress_segment(&targ);
+    for (int r = 0; r < repeats; r++) {
+        uint64_t c0 = now_cycles(), t0 = now_ns();
+        compress_segment(&targ);
+        uint64_t t1 = now_ns(), c1 = now_cycles();
+        keep_best(&best, t1 - t0, c1 - c0);
+    }
+    free(targ.counts);
+    free(targ.chars);
+    report("compress_segment", in->label, in->size, best);
+}
+
+void bench_pzip(const input_t* in, int repeats, int num_threads) {
+    pzip_ctx* ctx = pzip_create(num_threads, 0);
+    if (!ctx) {
+        fprintf(stderr, "my-bench: cannot create compressor\n");
+        exit(1);
+    }
+    char* out = NULL;
+    size_t out_cap = 0, out_len = 0;
+    timing_t best = {0};
+    pzip_compress_alloc(ctx, in->data, in->size, &out, &out_cap, &out_len);
+    for (int r = 0; r < repeats; r++) {
+        uint64_t c0 = now_cycles(), t0 = now_ns();
+        pzip_compress_alloc(ctx, in->data, in->size, &out, &out_cap, &out_len);
+        uint64_t t1 = now_ns(), c1 = now_cycles();
+        keep_best(&best, t1 - t0, c1 - c0);
+    }
+    char kernel[32];
+    snprintf(kernel, sizeof(kernel), "pzip %d thr", num_threads);
+    report(kernel, in->label, in->size, best);
+    free(out);
+    pzip_destroy(ctx);
+}
+
+void bench_zip(const input_t* in, int repeats) {
+    FILE* dest = fopen("/dev/null", "w");
+    if (!dest) {
+        perror("my-bench: cannot open /dev/null");
+        exit(1);
+    }
+    timing_t best = {0};
+    for (int r = 0; r < repeats; r++) {
+        FILE* src = fmemopen(in->data, in->size, "r");
+        uint64_t c0 = now_cycles(), t0 = now_ns();
+        zip(src, dest);
+        fflush(dest);
+        uint64_t t1 = now_ns(), c1 = now_cycles();
+        keep_best(&best, t1 - t0, c1 - c0);
+        fclose(src);
+    }
+    fclose(dest);
+    report("zip", in->label, in->size, best);
+}
+
+/* Measured per expanded (output) byte */
+void bench_unzip(const input_t* in, int repeats) {
+    size_t zipped_len;
+    char* zipped = zip_to_memory(in->data, in->size, &zipped_len);
+    char* name = write_temp_file(zipped, zipped_len);
+    timing_t best = {0};
+    for (int r = 0; r < repeats; r++) {
+        int saved = redirect_stdout("/dev/null");
+        uint64_t c0 = now_cycles(), t0 = now_ns();
+        unzip(name);
+        fflush(stdout);
+        uint64_t t1 = now_ns(), c1 = now_cycles();
+        restore_stdout(saved);
+        keep_best(&best, t1 - t0, c1 - c0);
+    }
+    report("unzip", in->label, in->size, best);
+    unlink(name);
+    free(name);
+    free(zipped);
+}
+
+void bench_search_word(const input_t* in, char* word, int repeats) {
+    char* name = write_temp_file(in->data, in->size);
+    timing_t best = {0};
+    for (int r = 0; r < repeats; r++) {
+        int saved = redirect_stdout("/dev/null");
+        uint64_t c0 = now_cycles(), t0 = now_ns();
+        search_word(word, name);
+        fflush(stdout);
+        uint64_t t1 = now_ns(), c1 = now_cycles();
+        restore_stdout(saved);
+        keep_best(&best, t1 - t0, c1 - c0);
+    }
+    report("search_word", in->label, in->size, best);
+    unlink(name);
+    free(name);
+}
+
+void run_benchmarks(size_t size, int repeats) {
+    size_t run_lengths[] = {1, 4, 64, 4096};
+    size_t line_lengths[] = {16, 80, 1024};
+    int densities[] = {0, 10, 100};
+    char word[] = "needle";
+    input_t in;
+    in.data = checked_malloc(size);
+    in.size = size;
+
+    printf("%-18s %-22s %10s %10s %12s\n", "kernel", "input", "bytes", "ns/byte", "cycles/byte");
+    for (size_t i = 0; i < sizeof(run_lengths) / sizeof(run_lengths[0]); i++) {
+        fill_runs(in.data, size, run_lengths[i], &LETTERS);
+        snprintf(in.label, sizeof(in.label), "mean run %zu", run_lengths[i]);
+        bench_compress_segment(&in, repeats);
+        bench_pzip(&in, repeats, get_nprocs());
+        bench_zip(&in, repeats);
+        bench_unzip(&in, repeats);
+    }
+    /* Latency of small buffer-to-buffer calls through the library */
+    for (size_t small = 64; small <= 4096; small *= 8) {
+        input_t tiny = in;
+        tiny.size = small;
+        fill_runs(tiny.data, small, 4, &LETTERS);
+        snprintf(tiny.label, sizeof(tiny.label), "small %zu", small);
+        bench_pzip(&tiny, repeats * 1000, get_nprocs());
+    }
+    for (size_t i = 0; i < sizeof(line_lengths) / sizeof(line_lengths[0]); i++) {
+        for (size_t j = 0; j < sizeof(densities) / sizeof(densities[0]); j++) {
+            fill_lines(in.data, size, line_lengths[i], word, densities[j]);
+            snprintf(in.label, sizeof(in.label), "line %zu match %d%%", line_lengths[i], densities[j]);
+            bench_search_word(&in, word, repeats);
+        }
+    }
+    free(in.data);
+}
+
+/*
+ Differential checks
+ */
+
+int failures = 0;
+const char* pzip_binary = "./my-pzip";
+
+void check(bool ok, const char* what, const input_t* in, int num_threads, size_t segment) {
+    if (ok)
+        return;
+    failures++;
+    if (num_threads > 0) {
+        fprintf(stderr, "my-bench: FAIL %s on '%s' (%zu bytes), threads %d, segment %zu\n",
+                what, in->label, in->size, num_threads, segment);
+    } else {
+        fprintf(stderr, "my-bench: FAIL %s on '%s' (%zu bytes)\n", what, in->label, in->size);
+    }
+}
+
+/* pzip output must equal my-zip output for every pool size and segment size, both for
+   whole-buffer compression and when the input arrives in appended pieces.
+   Only holds for bytes 0-127: my-zip drops bytes >= 0x80 while pzip keeps them,
+   see check_non_ascii */
+void check_pzip(const input_t* in, const char* expected, size_t expected_len, int max_threads) {
+    size_t segments[] = {1, 2, 3, 7, 64, 4096, PZIP_DEFAULT_SEGMENT};
+    char* out = NULL;
+    size_t out_cap = 0, out_len = 0;
+
+    for (int t = 1; t <= max_threads; t++) {
+        for (size_t s = 0; s < sizeof(segments) / sizeof(segments[0]); s++) {
+            pzip_ctx* ctx = pzip_create(t, segments[s]);
+            if (!ctx) {
+                fprintf(stderr, "my-bench: cannot create compressor\n");
+                exit(1);
+            }
+            int err = pzip_compress_alloc(ctx, in->data, in->size, &out, &out_cap, &out_len);
+            check(err == PZIP_OK && out_len == expected_len && memcmp(out, expected, out_len) == 0,
+                  "pzip_compress_alloc != zip", in, t, segments[s]);
+
+            /* Caller-provided buffer: one byte short must report the required size */
+            size_t needed = 0;
+            if (expected_len > 0) {
+                err = pzip_compress_buffer(ctx, in->data, in->size, out, expected_len - 1, &needed);
+                check(err == PZIP_ENOSPC && needed == expected_len,
+                      "pzip_compress_buffer ENOSPC size", in, t, segments[s]);
+            }
+            err = pzip_compress_buffer(ctx, in->data, in->size, out, out_cap, &out_len);
+            check(err == PZIP_OK && out_len == expected_len && memcmp(out, expected, out_len) == 0,
+                  "pzip_compress_buffer != zip", in, t, segments[s]);
+
+            /* Same input appended in pieces of growing size */
+            char* archive = checked_malloc(expected_len + PZIP_RUN_SIZE);
+            pzip_state state = {0};
+            size_t pos = 0, piece = 1;
+            bool ok = true;
+            while (ok && pos < in->size) {
+                size_t len = piece < in->size - pos ? piece : in->size - pos;
+                uint64_t offset;
+                err = pzip_compress_append(ctx, &state, in->data + pos, len, &out, &out_cap, &out_len, &offset);
+                ok = err == PZIP_OK && offset + out_len <= expected_len;
+                if (ok)
+                    memcpy(archive + offset, out, out_len);
+                pos += len;
+                piece = piece * 3 + 1;
+            }
+            check(ok && state.covered == in->size && state.archive_len == expected_len &&
+                  memcmp(archive, expected, expected_len) == 0,
+                  "pzip_compress_append != zip", in, t, segments[s]);
+            free(archive);
+            pzip_destroy(ctx);
+        }
+    }
+    free(out);
+}
+
+/* pzip_compress_fd and pzip_compress_fd_buffer must compress from the current position
+   of a regular file (after a header that was already read) and from a pipe */
+void check_pzip_fd(pzip_ctx* ctx, const input_t* in, const char* expected, size_t expected_len) {
+    const char header[] = "HDR";
+    size_t header_len = sizeof(header) - 1;
+    char* with_header = checked_malloc(header_len + in->size);
+    memcpy(with_header, header, header_len);
+    memcpy(with_header + header_len, in->data, in->size);
+    char* name = write_temp_file(with_header, header_len + in->size);
+    free(with_header);
+
+    char* out = NULL;
+    size_t out_cap = 0, out_len = 0;
+    char skipped[sizeof(header)];
+    int fd = open(name, O_RDONLY);
+    if (fd < 0 || read(fd, skipped, header_len) != (ssize_t) header_len) {
+        perror("my-bench: cannot read temporary file");
+        exit(1);
+    }
+    int err = pzip_compress_fd(ctx, fd, &out, &out_cap, &out_len);
+    check(err == PZIP_OK && out_len == expected_len && memcmp(out, expected, out_len) == 0,
+          "pzip_compress_fd (file) != zip", in, 0, 0);
+    check(lseek(fd, 0, SEEK_CUR) == (off_t) (header_len + in->size),
+          "pzip_compress_fd (file) position not at EOF", in, 0, 0);
+
+    /* Same from the caller-provided buffer entry point, too small first */
+    lseek(fd, header_len, SEEK_SET);
+    char* buffer = checked_malloc(expected_len);
+    if (expected_len > 0) {
+        err = pzip_compress_fd_buffer(ctx, fd, buffer, expected_len - 1, &out_len);
+        check(err == PZIP_ENOSPC && out_len == expected_len &&
+              lseek(fd, 0, SEEK_CUR) == (off_t) header_len,
+              "pzip_compress_fd_buffer ENOSPC", in, 0, 0);
+    }
+    err = pzip_compress_fd_buffer(ctx, fd, buffer, expected_len, &out_len);
+    check(err == PZIP_OK && out_len == expected_len && memcmp(buffer, expected, out_len) == 0,
+          "pzip_compress_fd_buffer (file) != zip", in, 0, 0);
+    free(buffer);
+    close(fd);
+    unlink(name);
+    free(name);
+
+    /* Pipe, fed by a child process so inputs larger than the pipe buffer work */
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("my-bench: pipe failed");
+        exit(1);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("my-bench: fork failed");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        size_t written = 0;
+        while (written < in->size) {
+            ssize_t n = write(fds[1], in->data + written, in->size - written);
+            if (n <= 0)
+                _exit(1);
+            written += n;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    err = pzip_compress_fd(ctx, fds[0], &out, &out_cap, &out_len);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    check(err == PZIP_OK && out_len == expected_len && memcmp(out, expected, out_len) == 0,
+          "pzip_compress_fd (pipe) != zip", in, 0, 0);
+    free(out);
+}
+
+/* unzip must restore the original input from an archive (my-zip or pzip output) */
+void check_round_trip(const input_t* in, const char* zipped, size_t zipped_len, const char* what) {
+    char* archive = write_temp_file(zipped, zipped_len);
+    char* restored = strdup("/tmp/my-bench-XXXXXX");
+    int fd = restored ? mkstemp(restored) : -1;
+    if (fd < 0) {
+        perror("my-bench: cannot create temporary file");
+        exit(1);
+    }
+    close(fd);
+
+    int saved = redirect_stdout(restored);
+    unzip(archive);
+    restore_stdout(saved);
+
+    size_t size;
+    char* data = read_file(restored, &size);
+    check(size == in->size && memcmp(data, in->data, size) == 0, what, in, 0, 0);
+    free(data);
+    unlink(archive);
+    unlink(restored);
+    free(archive);
+    free(restored);
+}
+
+/* Runs the my-pzip binary with args (args[0] included), stdout goes to out_path
+   unless it is NULL. Returns true if it exited with status 0. */
+bool run_pzip_binary(char* const args[], const char* out_path) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("my-bench: fork failed");
+        exit(1);
+    }
+    if (pid == 0) {
+        if (out_path) {
+            int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            if (fd < 0)
+                _exit(127);
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        execv(pzip_binary, args);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Incremental state kept by the my-pzip -a checks */
+typedef struct {
+    char log[64];       // Growing input file
+    char archive[64];   // Archive updated with -a
+    char state[64];     // State file my-pzip keeps next to the archive
+    input_t content;    // Current content of log
+    size_t capacity;    // Allocated size of content.data
+} append_check_t;
+
+void append_content(append_check_t* ac, const char* data, size_t size) {
+    if (ac->content.size + size > ac->capacity) {
+        ac->capacity = (ac->content.size + size) * 2;
+        ac->content.data = realloc(ac->content.data, ac->capacity);
+        if (!ac->content.data) {
+            perror("my-bench: malloc failed");
+            exit(1);
+        }
+    }
+    memcpy(ac->content.data + ac->content.size, data, size);
+    ac->content.size += size;
+}
+
+/* Appends size generated bytes to the log (continuing the last run when same_char) */
+void grow_log(append_check_t* ac, size_t size, bool same_char) {
+    char* data = checked_malloc(size);
+    static const alphabet_t log_chars = {"ab\nc", 4, "log"};
+    fill_runs(data, size, 20, &log_chars);
+    if (same_char && ac->content.size > 0)
+        memset(data, ac->content.data[ac->content.size - 1], size < 3 ? size : 3);
+    append_content(ac, data, size);
+    write_file(ac->log, data, size, true);
+    free(data);
+}
+
+/* my-pzip file1 [file2 ...] must equal my-zip of the concatenated files. The input is
+   split into num_files files at evenly spaced points. */
+void check_pzip_binary(const input_t* in, const char* expected, size_t expected_len, int num_files) {
+    char* names[4];
+    char* args[6] = {"my-pzip"};
+    for (int f = 0; f < num_files; f++) {
+        size_t start = in->size * f / num_files, end = in->size * (f + 1) / num_files;
+        names[f] = write_temp_file(in->data + start, end - start);
+        args[f + 1] = names[f];
+    }
+    args[num_files + 1] = NULL;
+
+    char* output = write_temp_file("", 0);
+    bool ran = run_pzip_binary(args, output);
+    size_t output_len = 0;
+    char* data = ran ? read_file(output, &output_len) : NULL;
+    check(ran && output_len == expected_len && memcmp(data, expected, expected_len) == 0,
+          num_files == 1 ? "my-pzip file != zip" : "my-pzip file1 file2 ... != zip", in, 0, 0);
+
+    free(data);
+    unlink(output);
+    free(output);
+    for (int f = 0; f < num_files; f++) {
+        unlink(names[f]);
+        free(names[f]);
+    }
+}
+
+/* Runs my-pzip -a and compares the archive with my-zip of the whole log */
+void append_step(append_check_t* ac, const char* label) {
+    char* args[] = {"my-pzip", "-a", ac->archive, ac->log, NULL};
+    snprintf(ac->content.label, sizeof(ac->content.label), "my-pzip -a: %s", label);
+    bool ran = run_pzip_binary(args, NULL);
+
+    size_t expected_len, archive_len = 0;
+    char* expected = zip_to_memory(ac->content.data, ac->content.size, &expected_len);
+    char* archive = ran ? read_file(ac->archive, &archive_len) : NULL;
+    check(ran && archive_len == expected_len && memcmp(archive, expected, expected_len) == 0,
+          "archive != zip", &ac->content, 0, 0);
+    free(expected);
+    free(archive);
+}
+
+/* Drives my-pzip -a over a growing file: first run, appends, truncation, rewritten and
+   rotated input, replaced archive and lost state. Every step must give the same archive
+   as compressing the whole file. */
+void check_pzip_append_cli(void) {
+    char dir[] = "/tmp/my-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("my-bench: cannot create temporary directory");
+        exit(1);
+    }
+    append_check_t ac = {0};
+    snprintf(ac.log, sizeof(ac.log), "%s/log", dir);
+    snprintf(ac.archive, sizeof(ac.archive), "%s/log.pz", dir);
+    snprintf(ac.state, sizeof(ac.state), "%s/log.pz.state", dir);
+    write_file(ac.log, "", 0, false);
+
+    grow_log(&ac, 1000, false);
+    append_step(&ac, "first run");
+    size_t appends[] = {0, 1, 7, 5000, 200000};
+    for (size_t i = 0; i < sizeof(appends) / sizeof(appends[0]); i++) {
+        grow_log(&ac, appends[i], false);
+        append_step(&ac, "append");
+        grow_log(&ac, appends[i], true);
+        append_step(&ac, "append continuing the open run");
+    }
+
+    /* Truncated input */
+    ac.content.size /= 2;
+    write_file(ac.log, ac.content.data, ac.content.size, false);
+    grow_log(&ac, 100, false);
+    append_step(&ac, "truncated input");
+
+    /* Rewritten in place with the same length and the same byte before the covered offset */
+    size_t pos = ac.content.size - 10;
+    ac.content.data[pos] = ac.content.data[pos] == 'x' ? 'y' : 'x';
+    write_file(ac.log, ac.content.data, ac.content.size, false);
+    grow_log(&ac, 3, false);
+    append_step(&ac, "rewritten input");
+
+    /* Rotated: a new file renamed over the log, differing only outside the hashed tail */
+    char rotated[80];
+    snprintf(rotated, sizeof(rotated), "%s.1", ac.log);
+    ac.content.data[0] = ac.content.data[0] == 'x' ? 'y' : 'x';
+    write_file(rotated, ac.content.data, ac.content.size, false);
+    if (rename(rotated, ac.log) < 0) {
+        perror("my-bench: rename failed");
+        exit(1);
+    }
+    grow_log(&ac, 50, false);
+    append_step(&ac, "rotated input");
+
+    /* Archive replaced by something else */
+    write_file(ac.archive, "\1\0\0\0q", 5, false);
+    grow_log(&ac, 20, false);
+    append_step(&ac, "replaced archive");
+
+    /* State file lost */
+    unlink(ac.state);
+    grow_log(&ac, 20, true);
+    append_step(&ac, "missing state");
+
+    unlink(ac.log);
+    unlink(ac.archive);
+    unlink(ac.state);
+    rmdir(dir);
+    free(ac.content.data);
+}
+
+/* Bytes >= 0x80 are where the tools differ: my-zip omits them (with a warning) while
+   pzip encodes every byte. Pins down both behaviours and that pzip stays lossless. */
+void check_non_ascii(pzip_ctx* ctx) {
+    input_t in = {"aa\xe9\xe9" "b", 5, "aa \\xe9 \\xe9 b"};
+    const char zip_expected[] = "\2\0\0\0a\1\0\0\0b";
+    const char pzip_expected[] = "\2\0\0\0a\2\0\0\0\xe9\1\0\0\0b";
+
+    /* my-zip reports each omitted byte on stderr, keep that out of the check output */
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+    size_t zipped_len;
+    char* zipped = zip_to_memory(in.data, in.size, &zipped_len);
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    check(zipped_len == sizeof(zip_expected) - 1 && memcmp(zipped, zip_expected, zipped_len) == 0,
+          "zip no longer omits bytes >= 0x80", &in, 0, 0);
+
+    char* out = NULL;
+    size_t out_cap = 0, out_len = 0;
+    int err = pzip_compress_alloc(ctx, in.data, in.size, &out, &out_cap, &out_len);
+    check(err == PZIP_OK && out_len == sizeof(pzip_expected) - 1 &&
+          memcmp(out, pzip_expected, out_len) == 0, "pzip does not keep bytes >= 0x80", &in, 0, 0);
+    if (err == PZIP_OK)
+        check_round_trip(&in, out, out_len, "pzip -> unzip (bytes >= 0x80)");
+    free(out);
+    free(zipped);
+}
+
+int run_checks(size_t size) {
+    int max_threads = get_nprocs();
+    if (max_threads < 8)
+        max_threads = 8;
+
+    bool have_binary = access(pzip_binary, X_OK) == 0;
+    if (!have_binary) {
+        fprintf(stderr, "my-bench: %s not found, build it or pass -p\n", pzip_binary);
+        failures++;
+    }
+    pzip_ctx* ctx = pzip_create(max_threads, 64);
+    if (!ctx) {
+        fprintf(stderr, "my-bench: cannot create compressor\n");
+        exit(1);
+    }
+    char* out = NULL;
+    size_t out_cap = 0, out_len = 0;
+
+    size_t sizes[] = {0, 1, 2, 5, 100, 4099, size};
+    size_t run_lengths[] = {1, 3, 50, 100000};
+    alphabet_t alphabets[] = {
+        {"a", 1, "a"},
+        {"ab", 2, "ab"},
+        LETTERS,
+        {"a\n\0b", 4, "a \\n \\0 b"},
+    };
+    input_t in;
+    in.data = checked_malloc(size);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        /* Fixed sizes larger than the buffer are skipped */
+        if (sizes[i] > size)
+            continue;
+        for (size_t j = 0; j < sizeof(run_lengths) / sizeof(run_lengths[0]); j++) {
+            for (size_t k = 0; k < sizeof(alphabets) / sizeof(alphabets[0]); k++) {
+                in.size = sizes[i];
+                fill_runs(in.data, in.size, run_lengths[j], &alphabets[k]);
+                snprintf(in.label, sizeof(in.label), "run %zu alphabet %s", run_lengths[j], alphabets[k].name);
+
+                size_t zipped_len;
+                char* zipped = zip_to_memory(in.data, in.size, &zipped_len);
+                check_pzip(&in, zipped, zipped_len, max_threads);
+                check_round_trip(&in, zipped, zipped_len, "zip -> unzip");
+                check_pzip_fd(ctx, &in, zipped, zipped_len);
+                if (pzip_compress_alloc(ctx, in.data, in.size, &out, &out_cap, &out_len) == PZIP_OK)
+                    check_round_trip(&in, out, out_len, "pzip -> unzip");
+                else
+                    check(false, "pzip_compress_alloc failed", &in, max_threads, 64);
+                if (have_binary) {
+                    check_pzip_binary(&in, zipped, zipped_len, 1);
+                    check_pzip_binary(&in, zipped, zipped_len, 3);
+                }
+                free(zipped);
+            }
+        }
+    }
+    free(in.data);
+    free(out);
+    check_non_ascii(ctx);
+    pzip_destroy(ctx);
+
+    if (have_binary)
+        check_pzip_append_cli();
+
+    if (failures) {
+        fprintf(stderr, "my-bench: %d differential checks failed\n", failures);
+        return 1;
+    }
+    printf("differential checks passed (threads 1-%d)\n", max_threads);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool checks_only = false;
+    size_t size = DEFAULT_SIZE;
+    int repeats = DEFAULT_REPEATS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            checks_only = true;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            size = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            pzip_binary = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: ./my-bench [-c] [-s size] [-r repeats] [-p my-pzip]\n");
+            exit(1);
+        }
+    }
+    if (size == 0 || repeats < 1) {
+        fprintf(stderr, "my-bench: size and repeats must be positive\n");
+        exit(1);
+    }
+
+    if (checks_only)
+        return run_checks(size < 65536 ? size : 65536) ? 1 : 0;
+    if (run_checks(65536))
+        return 1;
+    run_benchmarks(size, repeats);
+    return 0;
+}
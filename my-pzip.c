@@ -1,101 +1,253 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>    
 #include <sys/stat.h>   
 #include <fcntl.h>      
 #include <unistd.h>      
-#include <pthread.h>     
 #include <string.h>      
-#include <sys/sysinfo.h> 
+#include <errno.h>
+
+#include "pzip.h"
 
 
 //A lot of reference and code implementation constraints was used from this repository: https://github.com/Saggarwal9/Parallel-ZIP/blob/master/pzip.c
+//The compression itself (thread pool, compress_segment and merging) lives in pzip.c.
+//Build: gcc -o my-pzip my-pzip.c pzip.c -pthread
 
+/*
+ Path of the state file that describes archive for incremental mode: "<archive>.state".
+ */
+char* state_path(const char *archive) {
+    size_t len = strlen(archive);
+    char *path = malloc(len + sizeof(".state"));
+    if (!path) {
+        perror("pzip: malloc failed");
+        exit(1);
+    }
+    memcpy(path, archive, len);
+    memcpy(path + len, ".state", sizeof(".state"));
+    return path;
+}
+
+// Number of input bytes before the covered offset that the state file hashes
+#define STATE_HASH_BYTES 4096
 
+/*
+ Identifies the input and archive files the state belongs to. The hash covers the
+ last STATE_HASH_BYTES input bytes before the covered offset, so a rotated or
+ rewritten input is detected even if it reuses the inode and is long enough.
+ */
 typedef struct {
-    char *data;        // Pointer to input data
-    size_t start;      // Start of data segment
-    size_t end;        // End of data segment
-    int *counts;       // Dynamic array to store counts of the RLE
-    char *chars;       // Dynamic array to store corresponding characters (RLE)
-    int num_runs;      // Number of runs produced by this thread
-} thread_arg_t;
+    unsigned long long input_dev;
+    unsigned long long input_ino;
+    unsigned long long input_hash;
+    long long archive_mtime_sec;
+    long long archive_mtime_nsec;
+} state_check_t;
 
 /*
- Thread function that compresses a segment of the concatenated data.
- Run-Length Encoding overview: https://www.geeksforgeeks.org/run-length-encoding/
- POSIX threads: https://man7.org/linux/man-pages/man3/pthread_create.3.html
+ FNV-1a hash of the STATE_HASH_BYTES input bytes that end at covered.
+ FNV hash: http://www.isthe.com/chongo/tech/comp/fnv/
+ Returns 0 if the bytes could not be read.
  */
-void* compress_segment(void *arg) {
-    //Initializing variables
-    thread_arg_t *targ = (thread_arg_t*) arg;
-    size_t i = targ->start;
-    
-    // Print thread ID and segment boundaries.
-    fprintf(stderr, "Thread %lu: processing segment [%zu, %zu)\n",
-            (unsigned long)pthread_self(), targ->start, targ->end);
-    
+int covered_hash(int input_fd, unsigned long long covered, unsigned long long *hash) {
+    char buffer[STATE_HASH_BYTES];
+    size_t len = covered < STATE_HASH_BYTES ? covered : STATE_HASH_BYTES;
+    if (pread(input_fd, buffer, len, covered - len) != (ssize_t) len)
+        return 0;
+    *hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        *hash ^= (unsigned char) buffer[i];
+        *hash *= 1099511628211ULL;
+    }
+    return 1;
+}
+
+/*
+ Fills check for the current input and archive. Returns 0 on failure.
+ */
+int state_check(int archive_fd, int input_fd, unsigned long long covered, state_check_t *check) {
+    struct stat input_sb, archive_sb;
+    if (fstat(input_fd, &input_sb) < 0 || fstat(archive_fd, &archive_sb) < 0)
+        return 0;
+    if ((unsigned long long) input_sb.st_size < covered)
+        return 0;
+    check->input_dev = input_sb.st_dev;
+    check->input_ino = input_sb.st_ino;
+    check->archive_mtime_sec = archive_sb.st_mtim.tv_sec;
+    check->archive_mtime_nsec = archive_sb.st_mtim.tv_nsec;
+    return covered_hash(input_fd, covered, &check->input_hash);
+}
+
+/*
+ Loads the state of the previous run and checks that it still matches the archive
+ and the input: same input file (device and inode), same bytes before the covered
+ offset, and an archive that was not modified since it was written.
+ Returns 0 and a zeroed state when the archive has to be rebuilt.
+ */
+int load_state(const char *path, int archive_fd, int input_fd, pzip_state *state) {
+    memset(state, 0, sizeof(pzip_state));
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return 0; //No previous run
+
+    unsigned long long covered, archive_len;
+    unsigned int last_count;
+    int last_char;
+    state_check_t saved, current;
+    int fields = fscanf(fp, "%llu %llu %u %d %llu %llu %llu %lld %lld", &covered, &archive_len,
+                        &last_count, &last_char, &saved.input_dev, &saved.input_ino,
+                        &saved.input_hash, &saved.archive_mtime_sec, &saved.archive_mtime_nsec);
+    fclose(fp);
+    if (fields != 9 || archive_len < PZIP_RUN_SIZE)
+        return 0;
+
+    //Input must be the same file with the same covered bytes, archive untouched since the last run
+    if (!state_check(archive_fd, input_fd, covered, &current))
+        return 0;
+    if (current.input_dev != saved.input_dev || current.input_ino != saved.input_ino ||
+        current.input_hash != saved.input_hash ||
+        current.archive_mtime_sec != saved.archive_mtime_sec ||
+        current.archive_mtime_nsec != saved.archive_mtime_nsec)
+        return 0;
+
+    //Archive must be exactly what the previous run wrote, ending in the recorded run
+    struct stat sb;
+    if (fstat(archive_fd, &sb) < 0 || (unsigned long long) sb.st_size != archive_len)
+        return 0;
+    char last_run[PZIP_RUN_SIZE];
+    if (pread(archive_fd, last_run, PZIP_RUN_SIZE, archive_len - PZIP_RUN_SIZE) != PZIP_RUN_SIZE)
+        return 0;
+    uint32_t count;
+    memcpy(&count, last_run, sizeof(uint32_t));
+    if (count != last_count || last_run[sizeof(uint32_t)] != (char) last_char)
+        return 0;
+
+    state->covered = covered;
+    state->archive_len = archive_len;
+    state->last_count = last_count;
+    state->last_char = (char) last_char;
+    return 1;
+}
 
-    //If there is nothing to process, exit
-    if (i >= targ->end) {
-        targ->num_runs = 0;
-        return NULL;
+/*
+ Writes the state next to the archive. A temporary file and rename() are used so
+ a crash never leaves a half-written state behind.
+ */
+void save_state(const char *path, int archive_fd, int input_fd, const pzip_state *state) {
+    state_check_t check;
+    if (!state_check(archive_fd, input_fd, state->covered, &check)) {
+        perror("pzip: cannot write state");
+        exit(1);
     }
-    
-    //Allocate memory for the RLE results
-    int capacity = 16;
-    targ->counts = malloc(capacity * sizeof(int)); //Allocates memory to store RLE results
-    targ->chars = malloc(capacity * sizeof(char)); //Allocates memory to store RLE results
-    targ->num_runs = 0; //From start is zero
-    
 
-    //Assume that one character appears
-    int run_count = 1;
-
-    //Current character
-    char current_char = targ->data[i];
-    //Loops via each chartacter. 
-    for (i = targ->start + 1; i < targ->end; i++) {
-        char c = targ->data[i];
-
-        //If matches the previous, increase the count
-        if (c == current_char) {
-            run_count++;
-
-            //If not stpre the previous segment
-        } else {
-            if (targ->num_runs >= capacity) {
-                capacity *= 2;
-                targ->counts = realloc(targ->counts, capacity * sizeof(int)); //Dynamically store
-                targ->chars = realloc(targ->chars, capacity * sizeof(char)); //Dynamically store
-            }
-
-            //Store the run-length data, in the arrays
-            targ->counts[targ->num_runs] = run_count;
-            targ->chars[targ->num_runs] = current_char;
-            targ->num_runs++; //New RLE entry is added
-            current_char = c; //Start tracking new sequence
-            run_count = 1; //Reset the run_count
+    size_t len = strlen(path);
+    char *tmp = malloc(len + sizeof(".tmp"));
+    if (!tmp) {
+        perror("pzip: malloc failed");
+        exit(1);
+    }
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        perror("pzip: cannot write state");
+        exit(1);
+    }
+    fprintf(fp, "%llu %llu %u %d %llu %llu %llu %lld %lld\n", (unsigned long long) state->covered,
+            (unsigned long long) state->archive_len, (unsigned int) state->last_count,
+            (int) state->last_char, check.input_dev, check.input_ino, check.input_hash,
+            check.archive_mtime_sec, check.archive_mtime_nsec);
+    if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+        perror("pzip: cannot write state");
+        exit(1);
+    }
+    free(tmp);
+}
+
+/*
+ Incremental mode: compresses only the bytes appended to input since the previous
+ run and appends them to archive. The archive's last run is rewritten so it can
+ absorb the start of the new data, which keeps the archive byte-identical to a full
+ compression of input. Without a valid state the archive is rebuilt from scratch.
+ */
+void append_archive(const char *archive, const char *input) {
+    //Only regular files can be appended to, check before opening (a FIFO would block) and again after
+    struct stat sb;
+    if (stat(input, &sb) < 0) {
+        perror("pzip: cannot open file");
+        exit(1);
+    }
+    if (!S_ISREG(sb.st_mode)) {
+        fprintf(stderr, "pzip: -a input must be a regular file\n");
+        exit(1);
+    }
+    int input_fd = open(input, O_RDONLY);
+    if (input_fd < 0) {
+        perror("pzip: cannot open file");
+        exit(1);
+    }
+    if (fstat(input_fd, &sb) < 0 || !S_ISREG(sb.st_mode)) {
+        fprintf(stderr, "pzip: -a input must be a regular file\n");
+        exit(1);
+    }
+    int archive_fd = open(archive, O_RDWR | O_CREAT, 0644);
+    if (archive_fd < 0) {
+        perror("pzip: cannot open archive");
+        exit(1);
+    }
+    char *path = state_path(archive);
+    pzip_state state;
+    load_state(path, archive_fd, input_fd, &state);
+
+    pzip_ctx *ctx = pzip_create(0, 0);
+    if (!ctx) {
+        fprintf(stderr, "pzip: cannot create compressor\n");
+        exit(1);
+    }
+
+    char *output = NULL;
+    size_t output_cap = 0;
+    size_t output_len = 0;
+    uint64_t offset = 0;
+    int err = pzip_compress_append_fd(ctx, &state, input_fd, &output, &output_cap, &output_len, &offset);
+    if (err == PZIP_EIO) {
+        perror("pzip: cannot read file");
+        exit(1);
+    } else if (err == PZIP_EINVAL) {
+        fprintf(stderr, "pzip: input changed while compressing (shrunk or replaced)\n");
+        exit(1);
+    } else if (err != PZIP_OK) {
+        fprintf(stderr, "pzip: compression failed: out of memory\n");
+        exit(1);
+    }
+
+    //Replace the archive from offset, a rebuilt archive may be shorter than the old one
+    size_t written = 0;
+    while (written < output_len) {
+        ssize_t n = pwrite(archive_fd, output + written, output_len - written, offset + written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            perror("pzip: write error");
+            exit(1);
         }
+        written += n;
     }
-    
-    // Store the final run, if num_run will exceed the caacity, it will mean that arrays are full --> allocate more memory
-    if (targ->num_runs >= capacity) {
-        capacity++; //Increase the capacity
-        targ->counts = realloc(targ->counts, capacity * sizeof(int)); //Expand the array
-        targ->chars = realloc(targ->chars, capacity * sizeof(char)); //Expand the array
+    if (ftruncate(archive_fd, state.archive_len) < 0 || fsync(archive_fd) < 0) {
+        perror("pzip: write error");
+        exit(1);
     }
+    save_state(path, archive_fd, input_fd, &state);
 
-    //Storing new run,
-    targ->counts[targ->num_runs] = run_count; //Storing number of times character has appeared in the sequence
-    targ->chars[targ->num_runs] = current_char; //Index starts at 0, ensure that new run is stored in the correct position
-    targ->num_runs++; // Run is stored, increase the counter --> next run stored in the next available slot
-    
-    // Print thread completion with run count.
-    fprintf(stderr, "Thread %lu: finished with %d runs\n",
-            (unsigned long)pthread_self(), targ->num_runs);
-    
-    return NULL;
+    free(output);
+    free(path);
+    pzip_destroy(ctx);
+    close(archive_fd);
+    close(input_fd);
 }
 
 /*
@@ -103,8 +255,6 @@ void* compress_segment(void *arg) {
 Entry point for the parallel zip (pzip) program.
 
 Memory Mapping (mmap): https://www.geeksforgeeks.org/memory-mapping/
-get_nprocs(): https://man7.org/linux/man-pages/man3/get_nprocs.3.html
-pthread_join(): https://man7.org/linux/man-pages/man3/pthread_join.3.html
 fstat(): https://pubs.opengroup.org/onlinepubs/009696699/functions/fstat.html
 munmap(): https://pubs.opengroup.org/onlinepubs/000095399/functions/munmap.html
 
@@ -115,8 +265,20 @@ int main(int argc, char *argv[]) {
     //Check command-line for enough arguments (files are needed)
     if (argc < 2) {
         fprintf(stderr, "pzip: file1 [file2 ...]\n");
+        fprintf(stderr, "      -a archive file  (append new data of file to archive)\n");
         exit(1);
     }
+
+    //Incremental mode
+    if (strcmp(argv[1], "-a") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "pzip: -a archive file\n");
+            exit(1);
+        }
+        append_archive(argv[2], argv[3]);
+        return 0;
+    }
+
     // Compute total size for all input files.
     size_t total_size = 0; //Hold all file data here, from single or multiple files
 
@@ -162,6 +324,11 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
         size_t fsize = sb.st_size;
+        //Empty files add nothing, and mmap() rejects a zero length
+        if (fsize == 0) {
+            close(fd);
+            continue;
+        }
         // Maps the file into memory using nmap()
         //PROT_READ --> Allows reading
         //MAP_PRIVATE --> Changes are not visible to other processes
@@ -179,81 +346,32 @@ int main(int argc, char *argv[]) {
         close(fd);
     }
     
-    //Determine number of threads based on available processors.
-    int num_threads = get_nprocs();
-    if (num_threads > total_size)
-        num_threads = total_size; // Do not create more threads than bytes.
-    
-    // Create threads to process segments of big_buffer.
-    pthread_t *threads = malloc(num_threads * sizeof(pthread_t)); //Allocate the memory for thread IDs
-    thread_arg_t *targs = malloc(num_threads * sizeof(thread_arg_t)); //Allocate memory for thread arguments
-    size_t segment_size = total_size / num_threads; //Dividing buffer into equal-sized segments, for parrallel processing
-    //Creating threads
-    for (int i = 0; i < num_threads; i++) {
-        targs[i].data = big_buffer; //Assign data pointers
-        targs[i].start = i * segment_size; //Calculate the start index for the thread
-        targs[i].end = (i == num_threads - 1) ? total_size : (i + 1) * segment_size; //Calculate the end index of the thread
-        targs[i].counts = NULL; //Initialize the result storage
-        targs[i].chars = NULL; // Initialize the result storage
-        targs[i].num_runs = 0; // Initialize the result storage
-        pthread_create(&threads[i], NULL, compress_segment, &targs[i]); //Create the thread
-    }
-    
-    // Thread synchronization with pthread_join
-    for (int i = 0; i < num_threads; i++) {
-        pthread_join(threads[i], NULL); //pthread_join blocks execution until corresponding thread completes
-        //NULL means that return valuye from compress_segment is not returning (store the result in the targs[i])
+    //Create the compressor, one thread per available processor
+    pzip_ctx *ctx = pzip_create(0, 0);
+    if (!ctx) {
+        fprintf(stderr, "pzip: cannot create compressor\n");
+        exit(1);
     }
-    
-    // Allocate memory for merging.
-    //This block is merging the results from RLE, from multiple threads
-    int merged_capacity = 128; //Intially 128, can grow dynamically
-    int merged_count = 0; //Track of number stored in runs
-    int *merged_counts = malloc(merged_capacity * sizeof(int)); //Run lenghts
-    char *merged_chars = malloc(merged_capacity * sizeof(char)); //Characters
-    
-
-    //Iterate over threads
-    for (int i = 0; i < num_threads; i++) { //Iteration over each thread's result
-        for (int j = 0; j < targs[i].num_runs; j++) { //Iteration over each RLE result inside the thread
-            int count = targs[i].counts[j]; //Extract the count and characters
-            char ch = targs[i].chars[j];
-            // If previous run exists and characters match, combine them.
-            if (merged_count > 0 && merged_chars[merged_count - 1] == ch) { //Check if last character matches ch, if true, merges the runs by adding count to the last stored run
-                merged_counts[merged_count - 1] += count; //if true, merges the runs by adding count to the last stored run
-
-                //If previous character is different, a new run is stored
-            } else {
-                //Check if enough memory
-                if (merged_count >= merged_capacity) {
-                    merged_capacity *= 2; //Expand memory
-                    merged_counts = realloc(merged_counts, merged_capacity * sizeof(int));//Expand memory
-                    merged_chars = realloc(merged_chars, merged_capacity * sizeof(char));//Expand memory
-                }
-                //New run is stored
-                merged_counts[merged_count] = count;
-                merged_chars[merged_count] = ch;
-                merged_count++; //Track number of stored runs
-            }
-        }
 
-        //Free allocated memory, which were allocated by threads
-        free(targs[i].counts);
-        free(targs[i].chars);
+    //Compress the whole buffer, output is grown by the library
+    char *output = NULL;
+    size_t output_cap = 0;
+    size_t output_len = 0;
+    if (pzip_compress_alloc(ctx, big_buffer, total_size, &output, &output_cap, &output_len) != PZIP_OK) {
+        fprintf(stderr, "pzip: compression failed\n");
+        exit(1);
     }
     
     // Write merged runs as binary output: each run is a 4-byte integer followed by a 1-byte character.
-    for (int i = 0; i < merged_count; i++) {
-        fwrite(&merged_counts[i], sizeof(int), 1, stdout);
-        fwrite(&merged_chars[i], sizeof(char), 1, stdout);
+    if (fwrite(output, 1, output_len, stdout) != output_len) {
+        perror("pzip: write error");
+        exit(1);
     }
     
     // Free all allocated memory
-    free(merged_counts);
-    free(merged_chars);
-    free(threads);
-    free(targs);
+    free(output);
     free(big_buffer);
+    pzip_destroy(ctx);
     
     return 0;
 }
@@ -0,0 +1,530 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+
+#include "pzip_internal.h"
+
+
+//A lot of reference and code implementation constraints was used from this repository: https://github.com/Saggarwal9/Parallel-ZIP/blob/master/pzip.c
+
+typedef struct {
+    int have;          // Whether a run is open
+    uint64_t count;    // Length of the open run not yet covered by full UINT32_MAX records
+    char ch;           // Character of the open run
+} open_run_t;
+
+typedef struct {
+    pzip_ctx *ctx;     // Context the worker belongs to
+    int index;         // Index of the worker's thread_arg_t in ctx->targs
+} worker_arg_t;
+
+struct pzip_ctx {
+    int num_threads;          // Pool size including the calling thread
+    size_t min_segment;       // Smallest segment handed to one thread
+    thread_arg_t *targs;      // One per thread, targs[0] is used by the calling thread
+    worker_arg_t *wargs;      // Arguments of the worker threads
+    pthread_t *threads;       // Worker threads, process targs[1 .. num_threads - 1]
+    int num_started;          // Number of worker threads actually started
+    pthread_mutex_t lock;     // Protects the job fields below
+    pthread_cond_t work_ready;// Signalled when a new job is published or on shutdown
+    pthread_cond_t work_done; // Signalled when the last worker finishes a job
+    unsigned long generation; // Incremented for every published job
+    int active;               // Number of segments in the current job
+    int pending;              // Workers that have not yet finished the current job
+    int shutdown;             // Set by pzip_destroy()
+    char *input;              // Read buffer for pzip_compress_fd() on non-regular files
+    size_t input_cap;         // Allocated size of input
+};
+
+/*
+ Appends one run to the thread's arrays, doubling them when they are full.
+ */
+static int store_run(thread_arg_t *targ, uint32_t count, char ch) {
+    if (targ->num_runs >= targ->capacity) {
+        size_t capacity = targ->capacity ? targ->capacity * 2 : 16;
+        uint32_t *counts = realloc(targ->counts, capacity * sizeof(uint32_t));
+        if (!counts) {
+            targ->error = PZIP_ENOMEM;
+            return PZIP_ENOMEM;
+        }
+        targ->counts = counts;
+        char *chars = realloc(targ->chars, capacity * sizeof(char));
+        if (!chars) {
+            targ->error = PZIP_ENOMEM;
+            return PZIP_ENOMEM;
+        }
+        targ->chars = chars;
+        targ->capacity = capacity;
+    }
+    //Store the run-length data, in the arrays
+    targ->counts[targ->num_runs] = count;
+    targ->chars[targ->num_runs] = ch;
+    targ->num_runs++;
+    return PZIP_OK;
+}
+
+/*
+ Thread function that compresses a segment of the concatenated data.
+ Run-Length Encoding overview: https://www.geeksforgeeks.org/run-length-encoding/
+ POSIX threads: https://man7.org/linux/man-pages/man3/pthread_create.3.html
+ */
+void* compress_segment(void *arg) {
+    thread_arg_t *targ = (thread_arg_t*) arg;
+    targ->num_runs = 0;
+    targ->error = PZIP_OK;
+
+    //If there is nothing to process, exit
+    if (targ->start >= targ->end)
+        return NULL;
+
+    //Assume that one character appears
+    uint32_t run_count = 1;
+    char current_char = targ->data[targ->start];
+    for (size_t i = targ->start + 1; i < targ->end; i++) {
+        char c = targ->data[i];
+        //If matches the previous, increase the count (a full count starts a new run, like zip())
+        if (c == current_char && run_count < UINT32_MAX) {
+            run_count++;
+            continue;
+        }
+        //If not, store the previous run and start tracking the new one
+        if (store_run(targ, run_count, current_char) != PZIP_OK)
+            return NULL;
+        current_char = c;
+        run_count = 1;
+    }
+    //Store the final run
+    store_run(targ, run_count, current_char);
+    return NULL;
+}
+
+/*
+ Worker loop: waits for a new job generation, compresses its own segment if it
+ takes part in the job and reports back. Runs until pzip_destroy().
+ */
+static void* worker_main(void *arg) {
+    worker_arg_t *warg = (worker_arg_t*) arg;
+    pzip_ctx *ctx = warg->ctx;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (;;) {
+        while (!ctx->shutdown && ctx->generation == seen)
+            pthread_cond_wait(&ctx->work_ready, &ctx->lock);
+        if (ctx->shutdown)
+            break;
+        seen = ctx->generation;
+        //Small jobs do not use every worker
+        if (warg->index >= ctx->active)
+            continue;
+
+        pthread_mutex_unlock(&ctx->lock);
+        compress_segment(&ctx->targs[warg->index]);
+        pthread_mutex_lock(&ctx->lock);
+
+        if (--ctx->pending == 0)
+            pthread_cond_signal(&ctx->work_done);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+/*
+ Splits data into segments and compresses them in parallel. The calling thread
+ always compresses the first segment itself; inputs smaller than two segments
+ never touch the pool. Returns the number of segments or a PZIP_* error.
+ */
+static int run_segments(pzip_ctx *ctx, const char *data, size_t size) {
+    size_t active = size / ctx->min_segment;
+    if (active > (size_t) ctx->num_threads)
+        active = ctx->num_threads;
+    if (active < 1)
+        active = 1;
+
+    size_t segment_size = size / active; //Dividing buffer into equal-sized segments
+    for (size_t i = 0; i < active; i++) {
+        ctx->targs[i].data = data;
+        ctx->targs[i].start = i * segment_size;
+        ctx->targs[i].end = (i == active - 1) ? size : (i + 1) * segment_size;
+    }
+
+    if (active > 1) {
+        //Publish the job to the pool
+        pthread_mutex_lock(&ctx->lock);
+        ctx->active = active;
+        ctx->pending = active - 1;
+        ctx->generation++;
+        pthread_cond_broadcast(&ctx->work_ready);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    compress_segment(&ctx->targs[0]);
+
+    if (active > 1) {
+        //Wait until every worker of this job is done
+        pthread_mutex_lock(&ctx->lock);
+        while (ctx->pending > 0)
+            pthread_cond_wait(&ctx->work_done, &ctx->lock);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    for (size_t i = 0; i < active; i++) {
+        if (ctx->targs[i].error != PZIP_OK)
+            return ctx->targs[i].error;
+    }
+    return active;
+}
+
+static void put_run(char *out, uint32_t count, char ch) {
+    memcpy(out, &count, sizeof(uint32_t));
+    out[sizeof(uint32_t)] = ch;
+}
+
+/*
+ Merges the runs of the first num_segments segments, combining runs of the same
+ character across segment boundaries. run holds the run left open before the
+ first segment (if any) and is updated to the trailing run, which is also
+ written. Writes the encoded runs to out unless out is NULL.
+ Returns the encoded size in bytes.
+ */
+static size_t merge_runs(pzip_ctx *ctx, int num_segments, open_run_t *run, char *out) {
+    size_t len = 0;
+
+    for (int i = 0; i < num_segments; i++) {
+        thread_arg_t *targ = &ctx->targs[i];
+        for (size_t j = 0; j < targ->num_runs; j++) {
+            // If previous run exists and characters match, combine them.
+            if (run->have && targ->chars[j] == run->ch) {
+                run->count += targ->counts[j];
+                //Split off full records so the open run always fits in 4 bytes, as my-zip does
+                while (run->count > UINT32_MAX) {
+                    if (out)
+                        put_run(out + len, UINT32_MAX, run->ch);
+                    len += PZIP_RUN_SIZE;
+                    run->count -= UINT32_MAX;
+                }
+                continue;
+            }
+            if (run->have) {
+                if (out)
+                    put_run(out + len, run->count, run->ch);
+                len += PZIP_RUN_SIZE;
+            }
+            run->count = targ->counts[j];
+            run->ch = targ->chars[j];
+            run->have = 1;
+        }
+    }
+    if (run->have) {
+        if (out)
+            put_run(out + len, run->count, run->ch);
+        len += PZIP_RUN_SIZE;
+    }
+    return len;
+}
+
+/*
+ Grows *out to at least needed bytes.
+ */
+static int reserve_output(char **out, size_t *out_cap, size_t needed) {
+    if (needed <= *out_cap && *out)
+        return PZIP_OK;
+    char *grown = realloc(*out, needed ? needed : 1);
+    if (!grown)
+        return PZIP_ENOMEM;
+    *out = grown;
+    *out_cap = needed ? needed : 1;
+    return PZIP_OK;
+}
+
+pzip_ctx* pzip_create(int num_threads, size_t min_segment) {
+    if (num_threads < 0)
+        return NULL;
+    if (num_threads == 0)
+        num_threads = get_nprocs();
+    if (num_threads < 1)
+        num_threads = 1;
+
+    pzip_ctx *ctx = calloc(1, sizeof(pzip_ctx));
+    if (!ctx)
+        return NULL;
+    ctx->num_threads = num_threads;
+    ctx->min_segment = min_segment ? min_segment : PZIP_DEFAULT_SEGMENT;
+    ctx->targs = calloc(num_threads, sizeof(thread_arg_t));
+    ctx->wargs = calloc(num_threads, sizeof(worker_arg_t));
+    ctx->threads = calloc(num_threads, sizeof(pthread_t));
+    if (!ctx->targs || !ctx->wargs || !ctx->threads) {
+        pzip_destroy(ctx);
+        return NULL;
+    }
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->work_ready, NULL);
+    pthread_cond_init(&ctx->work_done, NULL);
+
+    //Start the workers once, they are reused by every call
+    for (int i = 1; i < num_threads; i++) {
+        ctx->wargs[i].ctx = ctx;
+        ctx->wargs[i].index = i;
+        if (pthread_create(&ctx->threads[i], NULL, worker_main, &ctx->wargs[i]) != 0) {
+            pzip_destroy(ctx);
+            return NULL;
+        }
+        ctx->num_started++;
+    }
+    return ctx;
+}
+
+void pzip_destroy(pzip_ctx *ctx) {
+    if (!ctx)
+        return;
+    if (ctx->targs && ctx->wargs && ctx->threads) {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->shutdown = 1;
+        pthread_cond_broadcast(&ctx->work_ready);
+        pthread_mutex_unlock(&ctx->lock);
+        for (int i = 1; i <= ctx->num_started; i++)
+            pthread_join(ctx->threads[i], NULL);
+        pthread_mutex_destroy(&ctx->lock);
+        pthread_cond_destroy(&ctx->work_ready);
+        pthread_cond_destroy(&ctx->work_done);
+    }
+    if (ctx->targs) {
+        for (int i = 0; i < ctx->num_threads; i++) {
+            free(ctx->targs[i].counts);
+            free(ctx->targs[i].chars);
+        }
+    }
+    free(ctx->targs);
+    free(ctx->wargs);
+    free(ctx->threads);
+    free(ctx->input);
+    free(ctx);
+}
+
+int pzip_compress_buffer(pzip_ctx *ctx, const char *data, size_t size,
+                         char *out, size_t out_cap, size_t *out_len) {
+    if (!ctx || (!data && size > 0) || !out_len)
+        return PZIP_EINVAL;
+
+    int num_segments = run_segments(ctx, data, size);
+    if (num_segments < 0)
+        return num_segments;
+
+    open_run_t run = {0};
+    *out_len = merge_runs(ctx, num_segments, &run, NULL);
+    if (*out_len > out_cap)
+        return PZIP_ENOSPC;
+    run.have = 0;
+    merge_runs(ctx, num_segments, &run, out);
+    return PZIP_OK;
+}
+
+int pzip_compress_alloc(pzip_ctx *ctx, const char *data, size_t size,
+                        char **out, size_t *out_cap, size_t *out_len) {
+    if (!ctx || (!data && size > 0) || !out || !out_cap || !out_len)
+        return PZIP_EINVAL;
+
+    int num_segments = run_segments(ctx, data, size);
+    if (num_segments < 0)
+        return num_segments;
+
+    open_run_t run = {0};
+    int err = reserve_output(out, out_cap, merge_runs(ctx, num_segments, &run, NULL));
+    if (err != PZIP_OK)
+        return err;
+    run.have = 0;
+    *out_len = merge_runs(ctx, num_segments, &run, *out);
+    return PZIP_OK;
+}
+
+/*
+ Reads fd until EOF into the context's input buffer.
+ */
+static int read_all(pzip_ctx *ctx, int fd, size_t *size) {
+    *size = 0;
+    for (;;) {
+        if (*size == ctx->input_cap) {
+            size_t capacity = ctx->input_cap ? ctx->input_cap * 2 : PZIP_DEFAULT_SEGMENT;
+            char *grown = realloc(ctx->input, capacity);
+            if (!grown)
+                return PZIP_ENOMEM;
+            ctx->input = grown;
+            ctx->input_cap = capacity;
+        }
+        ssize_t n = read(fd, ctx->input + *size, ctx->input_cap - *size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return PZIP_EIO;
+        }
+        if (n == 0)
+            return PZIP_OK;
+        *size += n;
+    }
+}
+
+typedef struct {
+    const char *data;  // Input bytes
+    size_t size;       // Number of input bytes
+    char *map;         // Mapping to release, NULL when data is ctx->input or empty
+    size_t map_len;    // Length of map
+    off_t end;         // File position after the input, -1 for non-seekable fds
+} fd_input_t;
+
+/*
+ Maps size bytes of fd starting at offset. mmap offsets must be page aligned, so the
+ mapping starts at the page holding offset.
+ Memory Mapping (mmap): https://www.geeksforgeeks.org/memory-mapping/
+ */
+static int map_input(int fd, uint64_t offset, size_t size, fd_input_t *in) {
+    in->data = NULL;
+    in->size = size;
+    in->map = NULL;
+    in->map_len = 0;
+    if (size == 0)
+        return PZIP_OK;
+
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    size_t skip = offset % page;
+    //PROT_READ --> Allows reading, MAP_PRIVATE --> Changes are not visible to other processes
+    char *map = mmap(NULL, size + skip, PROT_READ, MAP_PRIVATE, fd, offset - skip);
+    if (map == MAP_FAILED)
+        return PZIP_EIO;
+    in->map = map;
+    in->map_len = size + skip;
+    in->data = map + skip;
+    return PZIP_OK;
+}
+
+static void release_input(fd_input_t *in) {
+    if (in->map)
+        munmap(in->map, in->map_len);
+}
+
+/*
+ Loads fd from its current position to EOF. Regular files are mapped (the position
+ is not moved yet, see finish_input), other descriptors are read into ctx->input.
+ fstat(): https://pubs.opengroup.org/onlinepubs/009696699/functions/fstat.html
+ */
+static int load_input(pzip_ctx *ctx, int fd, fd_input_t *in) {
+    struct stat sb;
+    if (fstat(fd, &sb) < 0)
+        return PZIP_EIO;
+
+    if (!S_ISREG(sb.st_mode)) {
+        size_t size;
+        int err = read_all(ctx, fd, &size);
+        if (err != PZIP_OK)
+            return err;
+        in->data = ctx->input;
+        in->size = size;
+        in->map = NULL;
+        in->end = -1;
+        return PZIP_OK;
+    }
+
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0)
+        return PZIP_EIO;
+    size_t size = sb.st_size > pos ? sb.st_size - pos : 0;
+    in->end = pos + size;
+    return map_input(fd, pos, size, in);
+}
+
+/*
+ Releases the input and, after a successful call, moves a regular file's position
+ past the compressed bytes like read() would have.
+ */
+static int finish_input(int fd, fd_input_t *in, int err) {
+    release_input(in);
+    if (err == PZIP_OK && in->end >= 0 && lseek(fd, in->end, SEEK_SET) < 0)
+        return PZIP_EIO;
+    return err;
+}
+
+int pzip_compress_fd(pzip_ctx *ctx, int fd,
+                     char **out, size_t *out_cap, size_t *out_len) {
+    if (!ctx || fd < 0)
+        return PZIP_EINVAL;
+
+    fd_input_t in;
+    int err = load_input(ctx, fd, &in);
+    if (err != PZIP_OK)
+        return err;
+    err = pzip_compress_alloc(ctx, in.data, in.size, out, out_cap, out_len);
+    return finish_input(fd, &in, err);
+}
+
+int pzip_compress_fd_buffer(pzip_ctx *ctx, int fd,
+                            char *out, size_t out_cap, size_t *out_len) {
+    if (!ctx || fd < 0)
+        return PZIP_EINVAL;
+
+    fd_input_t in;
+    int err = load_input(ctx, fd, &in);
+    if (err != PZIP_OK)
+        return err;
+    err = pzip_compress_buffer(ctx, in.data, in.size, out, out_cap, out_len);
+    return finish_input(fd, &in, err);
+}
+
+int pzip_compress_append(pzip_ctx *ctx, pzip_state *state, const char *data, size_t size,
+                         char **out, size_t *out_cap, size_t *out_len, uint64_t *out_offset) {
+    if (!ctx || !state || (!data && size > 0) || !out || !out_cap || !out_len || !out_offset)
+        return PZIP_EINVAL;
+    if (state->archive_len > 0 && state->archive_len < PZIP_RUN_SIZE)
+        return PZIP_EINVAL;
+
+    int num_segments = run_segments(ctx, data, size);
+    if (num_segments < 0)
+        return num_segments;
+
+    //The archive's trailing run is rewritten, merged with the new data if it continues it
+    open_run_t start = {0};
+    uint64_t offset = state->archive_len;
+    if (state->archive_len > 0) {
+        start.have = 1;
+        start.count = state->last_count;
+        start.ch = state->last_char;
+        offset -= PZIP_RUN_SIZE;
+    }
+
+    open_run_t run = start;
+    int err = reserve_output(out, out_cap, merge_runs(ctx, num_segments, &run, NULL));
+    if (err != PZIP_OK)
+        return err;
+    run = start;
+    *out_len = merge_runs(ctx, num_segments, &run, *out);
+    *out_offset = offset;
+
+    state->covered += size;
+    state->archive_len = offset + *out_len;
+    state->last_count = run.have ? run.count : 0;
+    state->last_char = run.have ? run.ch : 0;
+    return PZIP_OK;
+}
+
+int pzip_compress_append_fd(pzip_ctx *ctx, pzip_state *state, int fd,
+                            char **out, size_t *out_cap, size_t *out_len, uint64_t *out_offset) {
+    if (!ctx || !state || fd < 0)
+        return PZIP_EINVAL;
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0)
+        return PZIP_EIO;
+    if (!S_ISREG(sb.st_mode) || (uint64_t) sb.st_size < state->covered)
+        return PZIP_EINVAL;
+
+    fd_input_t in;
+    int err = map_input(fd, state->covered, sb.st_size - state->covered, &in);
+    if (err != PZIP_OK)
+        return err;
+    err = pzip_compress_append(ctx, state, in.data, in.size, out, out_cap, out_len, out_offset);
+    release_input(&in);
+    return err;
+}
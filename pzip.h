@@ -0,0 +1,112 @@
+#ifndef PZIP_H
+#define PZIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ Embeddable parallel run-length compressor used by my-pzip.
+
+ The output format is the same as my-pzip/my-zip: each run is a 4-byte unsigned
+ integer (native byte order) followed by a 1-byte character. Like my-zip, runs
+ longer than UINT32_MAX are split into several records.
+
+ A context owns a pool of worker threads that is created once in pzip_create()
+ and reused by every compression call, so no threads are created per call.
+ Small inputs are compressed directly on the calling thread. The library never
+ prints anything; errors are reported through the PZIP_* return codes.
+
+ A context must not be used by more than one thread at the same time.
+
+ Build: gcc -o my-pzip my-pzip.c pzip.c -pthread
+ */
+
+#define PZIP_OK       0
+#define PZIP_ENOMEM  -1  // Allocation failed
+#define PZIP_ENOSPC  -2  // Caller-provided output buffer too small
+#define PZIP_EIO     -3  // Reading or mapping the input failed (errno is set)
+#define PZIP_EINVAL  -4  // Invalid argument
+
+// Size of one encoded run: 4-byte count followed by a 1-byte character
+#define PZIP_RUN_SIZE (sizeof(uint32_t) + sizeof(char))
+
+// Default minimum number of input bytes given to one thread
+#define PZIP_DEFAULT_SEGMENT (64 * 1024)
+
+typedef struct pzip_ctx pzip_ctx;
+
+/*
+ Describes an existing archive for incremental (append) compression.
+ A zeroed state describes an empty archive of empty input.
+ */
+typedef struct {
+    uint64_t covered;      // Input bytes encoded by the archive
+    uint64_t archive_len;  // Size of the archive in bytes
+    uint32_t last_count;   // Trailing open run of the archive, may still grow
+    char last_char;        // Character of the trailing open run
+} pzip_state;
+
+/*
+ Creates a compressor context.
+ num_threads: size of the worker pool including the calling thread, 0 = get_nprocs().
+ min_segment: smallest input segment handed to one thread, 0 = PZIP_DEFAULT_SEGMENT.
+ Returns NULL if the context or its threads could not be created.
+ */
+pzip_ctx* pzip_create(int num_threads, size_t min_segment);
+
+// Stops the worker pool and frees everything owned by the context.
+void pzip_destroy(pzip_ctx *ctx);
+
+/*
+ Compresses size bytes of data into the caller-provided buffer out of out_cap bytes.
+ *out_len is set to the compressed size. If out_cap is too small, nothing is
+ written, PZIP_ENOSPC is returned and *out_len holds the required size.
+ */
+int pzip_compress_buffer(pzip_ctx *ctx, const char *data, size_t size,
+                         char *out, size_t out_cap, size_t *out_len);
+
+/*
+ Compresses size bytes of data into a growable buffer.
+ *out may be NULL or a buffer from malloc() of *out_cap bytes; it is realloc'd
+ when needed, so the same buffer can be reused across calls. The caller frees it.
+ */
+int pzip_compress_alloc(pzip_ctx *ctx, const char *data, size_t size,
+                        char **out, size_t *out_cap, size_t *out_len);
+
+/*
+ Same as pzip_compress_alloc(), but the input is everything in fd from its current
+ position to EOF, and the position ends up at EOF as if it had been read. Regular
+ files are memory mapped, other descriptors (pipes, sockets) are read.
+ */
+int pzip_compress_fd(pzip_ctx *ctx, int fd,
+                     char **out, size_t *out_cap, size_t *out_len);
+
+/*
+ Same as pzip_compress_fd(), but compresses into the caller-provided buffer out
+ like pzip_compress_buffer(). On PZIP_ENOSPC a regular file's position is left
+ unchanged so the call can be retried with a larger buffer; bytes read from a pipe
+ or socket are consumed, so use pzip_compress_fd() for those.
+ */
+int pzip_compress_fd_buffer(pzip_ctx *ctx, int fd,
+                            char *out, size_t out_cap, size_t *out_len);
+
+/*
+ Compresses size bytes of data that were appended to the input described by state.
+ The output replaces the archive from *out_offset onwards: it starts with the
+ archive's trailing run (merged with the first new run when the characters match)
+ followed by the new runs. Writing it there gives the same bytes as compressing
+ the whole input again. On success state is updated to describe the new archive.
+ Output buffer handling is the same as in pzip_compress_alloc().
+ */
+int pzip_compress_append(pzip_ctx *ctx, pzip_state *state, const char *data, size_t size,
+                         char **out, size_t *out_cap, size_t *out_len, uint64_t *out_offset);
+
+/*
+ Same as pzip_compress_append(), but compresses the bytes of the regular file fd
+ from state->covered to its end. Returns PZIP_EINVAL if the file is shorter than
+ state->covered (e.g. it was truncated or rotated).
+ */
+int pzip_compress_append_fd(pzip_ctx *ctx, pzip_state *state, int fd,
+                            char **out, size_t *out_cap, size_t *out_len, uint64_t *out_offset);
+
+#endif
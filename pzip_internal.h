@@ -0,0 +1,28 @@
+#ifndef PZIP_INTERNAL_H
+#define PZIP_INTERNAL_H
+
+#include "pzip.h"
+
+/*
+ Internals of pzip.c shared with my-bench, not part of the embedding API.
+ */
+
+typedef struct {
+    const char *data;  // Pointer to input data
+    size_t start;      // Start of data segment
+    size_t end;        // End of data segment
+    uint32_t *counts;  // Dynamic array to store counts of the RLE
+    char *chars;       // Dynamic array to store corresponding characters (RLE)
+    size_t num_runs;   // Number of runs produced by this thread
+    size_t capacity;   // Allocated length of counts and chars, reused between calls
+    int error;         // PZIP_ENOMEM if the arrays could not grow
+} thread_arg_t;
+
+/*
+ Compresses data[start, end) of a thread_arg_t into its counts/chars arrays.
+ Runs longer than UINT32_MAX are stored as several runs of the same character.
+ Arrays that are already allocated are reused and only grow when needed.
+ */
+void* compress_segment(void *arg);
+
+#endif